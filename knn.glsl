@@ -5,6 +5,9 @@ layout(rg32f, binding = 0) uniform image2D data;
 layout(rg32f, binding = 1) uniform image2D queries;
 layout(rg32f, binding = 2) uniform image2D dist;
 
+uniform int query_offset;
+uniform bool single_precision;
+
 double join(in vec2 fv) {
 	return double(fv.x) + double(fv.y);
 }
@@ -19,17 +22,30 @@ vec2 split(in double a) {
 
 void main() {
 	ivec2 coord = ivec2(gl_GlobalInvocationID.xy);
+	int query_idx = coord.x + query_offset;
 	int dim = imageSize(data).x;
-	double sum = 0;
-	for (int i = 0; i < dim; i++) {
-		vec2 qv = imageLoad(queries, ivec2(i, coord.x)).xy;
-		vec2 dv = imageLoad(data, ivec2(i, coord.y)).xy;
-		double qvd = join(qv);
-		double dvd = join(dv);
-		double diff = abs(qvd - dvd);
-		sum += diff * diff;
+	double val;
+	if (single_precision) {
+		float sum = 0.0;
+		for (int i = 0; i < dim; i++) {
+			vec2 qv = imageLoad(queries, ivec2(i, query_idx)).xy;
+			vec2 dv = imageLoad(data, ivec2(i, coord.y)).xy;
+			float diff = (qv.x + qv.y) - (dv.x + dv.y);
+			sum += diff * diff;
+		}
+		val = double(sqrt(sum));
+	} else {
+		double sum = 0;
+		for (int i = 0; i < dim; i++) {
+			vec2 qv = imageLoad(queries, ivec2(i, query_idx)).xy;
+			vec2 dv = imageLoad(data, ivec2(i, coord.y)).xy;
+			double qvd = join(qv);
+			double dvd = join(dv);
+			double diff = abs(qvd - dvd);
+			sum += diff * diff;
+		}
+		val = sqrt(sum);
 	}
-	double val = sqrt(sum);
 	vec2 val_vec = split(val);
 	vec4 pixel = vec4(val_vec.x, val_vec.y, 0, 0);
 	imageStore(dist, coord, pixel);
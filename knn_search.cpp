@@ -0,0 +1,325 @@
+#include "knn_search.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+
+vectors parse_vectors(const std::string &filename) {
+    std::ifstream inp(filename);
+    if (inp.fail())
+        throw std::runtime_error("Failed to open " + filename);
+
+    char magic[6] = {0};
+    char exp_magic[] = "\x93NUMPY";
+    if (inp.read(magic, sizeof(magic)).fail())
+        throw std::runtime_error("Failed to read magic from " + filename);
+    if (memcmp(magic, exp_magic, sizeof(magic)) != 0)
+        throw std::runtime_error("Magic bytes not matching");
+
+    uint8_t version[2];
+    if (inp.read(reinterpret_cast<char *>(version), sizeof(version)).fail())
+        throw std::runtime_error("Failed to read version from " + filename);
+
+    size_t size_len = version[0] == 1 ? 2 : 4;
+    union {
+        uint32_t v2;
+        uint16_t v1;
+    } read_size = {0};
+    if (inp.read(reinterpret_cast<char *>(&read_size), size_len).fail())
+        throw std::runtime_error("Failed to read size from " + filename);
+    auto size = *reinterpret_cast<uint32_t *>(&read_size);
+
+    std::string header(size, '\0');
+    if (inp.read(header.data(), size).fail())
+        throw std::runtime_error("Failed to read header from " + filename);
+
+    auto shape_pos = header.find("shape");
+    auto shape_val_pos = shape_pos + 8;
+    auto shape_val_end = header.find_first_of(")", shape_val_pos);
+    auto shape_val =
+        header.substr(shape_val_pos + 1, shape_val_end - shape_val_pos - 1);
+    auto comma_pos = shape_val.find(",");
+
+    int vector_cnt = std::stoi(shape_val.substr(0, comma_pos));
+    int vector_dim = std::stoi(shape_val.substr(comma_pos + 2));
+
+    std::vector<double> vecs(vector_cnt * vector_dim);
+    if (inp.read(reinterpret_cast<char *>(vecs.data()),
+                 vecs.size() * sizeof(double))
+            .fail()) {
+        throw std::runtime_error("Failed to read vector from " + filename);
+    }
+
+    return vectors(std::move(vecs), vector_dim, vector_cnt);
+}
+
+void split_double(std::vector<double> &vec) {
+    constexpr double splitter = (1 << 29) + 1;
+    for (double &a : vec) {
+        double t = a * splitter;
+        float t_hi = t - (t - a);
+        float t_lo = a - t_hi;
+        memcpy(&a, &t_lo, sizeof(t_lo));
+        memcpy(reinterpret_cast<char *>(&a) + sizeof(float), &t_hi,
+               sizeof(t_hi));
+    }
+}
+
+void join_double(std::vector<double> &vec) {
+    for (double &a : vec) {
+        float t_lo, t_hi;
+        memcpy(&t_lo, &a, sizeof(t_lo));
+        memcpy(&t_hi, reinterpret_cast<char *>(&a) + sizeof(float),
+               sizeof(t_hi));
+        a = static_cast<double>(t_lo) + static_cast<double>(t_hi);
+    }
+}
+
+GLint get_uniform_location(GLint program, const std::string &name) {
+    auto loc = glGetUniformLocation(program, name.c_str());
+    if (loc == -1)
+        throw std::runtime_error("failed to find location of uniform: " + name);
+    handleGlError();
+    return loc;
+}
+
+const char *precision_mode_name(precision_mode mode) {
+    switch (mode) {
+    case precision_mode::emulated_double:
+        return "double";
+    case precision_mode::single:
+        return "float";
+    }
+    return "unknown";
+}
+
+// Texture units, matching the bindings in knn.glsl and rerank.glsl
+constexpr GLuint data_unit = 0;
+constexpr GLuint query_unit = 1;
+constexpr GLuint dist_unit = 2;
+constexpr GLuint cand_unit = 3;
+
+// Every texel is a split double: two floats
+constexpr size_t texel_size = 2 * sizeof(float);
+
+gl_texture make_texture(GLuint width, GLuint height, GLenum format) {
+    GLuint id;
+    glGenTextures(1, &id);
+    gl_texture tex(id);
+    glBindTexture(GL_TEXTURE_2D, id);
+    glTextureStorage2D(id, 1, format, width, height);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return tex;
+}
+
+gl_texture vectors_to_texture(const vectors &vecs) {
+    auto split = vecs.vec;
+    split_double(split);
+    auto tex = make_texture(vecs.dim, vecs.cnt);
+    glTextureSubImage2D(tex.get(), 0, 0, 0, vecs.dim, vecs.cnt, GL_RG,
+                        GL_FLOAT, split.data());
+    return tex;
+}
+
+static gl_program load_compute_program(const std::string &name) {
+    auto shader = loadShader(name, GL_COMPUTE_SHADER);
+    try {
+        std::vector<GLuint> shaders{shader};
+        gl_program program(createProgram(shaders));
+        glDeleteShader(shader);
+        return program;
+    } catch (...) {
+        glDeleteShader(shader);
+        throw;
+    }
+}
+
+gl_texture project_texture(const gl_program &program,
+                           const gl_texture &src_tex, size_t cnt,
+                           const gl_texture &proj_tex, size_t out_dim) {
+    auto dst_tex = make_texture(out_dim, cnt);
+    glUseProgram(program.get());
+    glBindImageTexture(0, src_tex.get(), 0, GL_FALSE, 0, GL_READ_ONLY,
+                       GL_RG32F);
+    glBindImageTexture(1, proj_tex.get(), 0, GL_FALSE, 0, GL_READ_ONLY,
+                       GL_RG32F);
+    glBindImageTexture(2, dst_tex.get(), 0, GL_FALSE, 0, GL_WRITE_ONLY,
+                       GL_RG32F);
+    glDispatchCompute(out_dim, cnt, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    handleGlError();
+    return dst_tex;
+}
+
+// Checks the dimension before any upload, so mismatched sets fail early
+static gl_texture upload_matching(const vectors &vecs, size_t dim) {
+    if (vecs.dim != dim)
+        throw std::runtime_error("Data and query vecs don't match dimensions");
+    return vectors_to_texture(vecs);
+}
+
+knn_searcher::knn_searcher(const vectors &data, const vectors &queries,
+                           size_t batch, precision_mode mode)
+    : knn_searcher(upload_matching(data, queries.dim),
+                   upload_matching(queries, data.dim), data.dim, data.cnt,
+                   queries.cnt, batch, mode) {}
+
+knn_searcher::knn_searcher(gl_texture data_tex, gl_texture query_tex,
+                           size_t dim, size_t data_cnt, size_t query_cnt,
+                           size_t batch, precision_mode mode)
+    : dim(dim), data_cnt(data_cnt), query_cnt(query_cnt),
+      batch_(std::min(batch, query_cnt)), mode(mode),
+      data_tex(std::move(data_tex)), query_tex(std::move(query_tex)) {
+    if (batch_ == 0)
+        throw std::runtime_error("Batch size must be positive");
+
+    program = load_compute_program("../knn.glsl");
+    query_offset_loc = get_uniform_location(program.get(), "query_offset");
+    single_precision_loc =
+        get_uniform_location(program.get(), "single_precision");
+
+    dist_tex = make_texture(batch_, data_cnt);
+    handleGlError();
+}
+
+size_t knn_searcher::gpu_bytes() const {
+    return (data_cnt * dim + query_cnt * dim + batch_ * data_cnt) * texel_size;
+}
+
+std::vector<double> knn_searcher::distances(size_t offset, size_t cnt) {
+    if (cnt > batch_ || offset + cnt > query_cnt)
+        throw std::runtime_error("Query range out of bounds");
+
+    glUseProgram(program.get());
+    glUniform1i(query_offset_loc, offset);
+    glUniform1i(single_precision_loc, mode == precision_mode::single);
+    glBindImageTexture(data_unit, data_tex.get(), 0, GL_FALSE, 0, GL_READ_ONLY,
+                       GL_RG32F);
+    glBindImageTexture(query_unit, query_tex.get(), 0, GL_FALSE, 0,
+                       GL_READ_ONLY, GL_RG32F);
+    glBindImageTexture(dist_unit, dist_tex.get(), 0, GL_FALSE, 0,
+                       GL_READ_WRITE, GL_RG32F);
+
+    glDispatchCompute(cnt, data_cnt, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT |
+                    GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+    std::vector<double> dist(data_cnt * cnt, -1.0f);
+    glGetTextureSubImage(dist_tex.get(), 0, 0, 0, 0, cnt, data_cnt, 1, GL_RG,
+                         GL_FLOAT, dist.size() * sizeof(double), dist.data());
+    handleGlError();
+    join_double(dist);
+    return dist;
+}
+
+void knn_searcher::search(size_t offset, size_t cnt, size_t k,
+                          std::vector<size_t> &idx, std::vector<double> &dist) {
+    select_topk(distances(offset, cnt), cnt, data_cnt, k, idx, dist);
+}
+
+two_stage_searcher::two_stage_searcher(const vectors &data,
+                                       const vectors &queries,
+                                       const vectors &projection,
+                                       size_t rerank_k, size_t batch,
+                                       precision_mode mode)
+    : dim(data.dim), data_cnt(data.cnt), query_cnt(queries.cnt),
+      reduced_dim(projection.cnt), rerank_k(std::min(rerank_k, data.cnt)) {
+    if (data.dim != queries.dim)
+        throw std::runtime_error("Data and query vecs don't match dimensions");
+    if (projection.dim != data.dim)
+        throw std::runtime_error("Projection doesn't match data dimensions");
+    if (this->rerank_k == 0)
+        throw std::runtime_error("Rerank count must be positive");
+
+    data_tex = vectors_to_texture(data);
+    query_tex = vectors_to_texture(queries);
+
+    auto project_program = load_compute_program("../project.glsl");
+    auto proj_tex = vectors_to_texture(projection);
+    auto reduced_data_tex = project_texture(project_program, data_tex,
+                                            data_cnt, proj_tex, reduced_dim);
+    auto reduced_query_tex = project_texture(
+        project_program, query_tex, query_cnt, proj_tex, reduced_dim);
+    prefilter = std::make_unique<knn_searcher>(
+        std::move(reduced_data_tex), std::move(reduced_query_tex), reduced_dim,
+        data_cnt, query_cnt, batch, mode);
+
+    rerank_program = load_compute_program("../rerank.glsl");
+    query_offset_loc =
+        get_uniform_location(rerank_program.get(), "query_offset");
+
+    cand_tex = make_texture(this->rerank_k, prefilter->batch(), GL_R32I);
+    rerank_dist_tex = make_texture(this->rerank_k, prefilter->batch());
+    handleGlError();
+}
+
+size_t two_stage_searcher::gpu_bytes() const {
+    size_t full = (data_cnt + query_cnt) * dim * texel_size;
+    size_t rerank = rerank_k * batch() * (sizeof(GLint) + texel_size);
+    return full + prefilter->gpu_bytes() + rerank;
+}
+
+void two_stage_searcher::search(size_t offset, size_t cnt, size_t k,
+                                std::vector<size_t> &idx,
+                                std::vector<double> &dist) {
+    if (k > rerank_k)
+        throw std::runtime_error("k exceeds the rerank count");
+
+    std::vector<size_t> cand_idx;
+    std::vector<double> cand_dist;
+    prefilter->search(offset, cnt, rerank_k, cand_idx, cand_dist);
+    std::vector<GLint> cand(cand_idx.begin(), cand_idx.end());
+
+    glUseProgram(rerank_program.get());
+    glUniform1i(query_offset_loc, offset);
+    glTextureSubImage2D(cand_tex.get(), 0, 0, 0, rerank_k, cnt,
+                        GL_RED_INTEGER, GL_INT, cand.data());
+    glBindImageTexture(data_unit, data_tex.get(), 0, GL_FALSE, 0, GL_READ_ONLY,
+                       GL_RG32F);
+    glBindImageTexture(query_unit, query_tex.get(), 0, GL_FALSE, 0,
+                       GL_READ_ONLY, GL_RG32F);
+    glBindImageTexture(dist_unit, rerank_dist_tex.get(), 0, GL_FALSE, 0,
+                       GL_READ_WRITE, GL_RG32F);
+    glBindImageTexture(cand_unit, cand_tex.get(), 0, GL_FALSE, 0,
+                       GL_READ_ONLY, GL_R32I);
+
+    glDispatchCompute(rerank_k, cnt, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT |
+                    GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+    std::vector<double> exact(rerank_k * cnt);
+    glGetTextureSubImage(rerank_dist_tex.get(), 0, 0, 0, 0, rerank_k, cnt, 1,
+                         GL_RG, GL_FLOAT, exact.size() * sizeof(double),
+                         exact.data());
+    handleGlError();
+    join_double(exact);
+
+    std::vector<std::pair<double, size_t>> row(rerank_k);
+    for (size_t q = 0; q < cnt; q++) {
+        for (size_t i = 0; i < rerank_k; i++)
+            row[i] = {exact[q * rerank_k + i], cand_idx[q * rerank_k + i]};
+        std::partial_sort(row.begin(), row.begin() + k, row.end());
+        for (size_t i = 0; i < k; i++) {
+            idx.push_back(row[i].second);
+            dist.push_back(row[i].first);
+        }
+    }
+}
+
+void select_topk(const std::vector<double> &dist, size_t query_cnt,
+                 size_t data_cnt, size_t k, std::vector<size_t> &idx,
+                 std::vector<double> &out_dist) {
+    k = std::min(k, data_cnt);
+    std::vector<std::pair<double, size_t>> column(data_cnt);
+    for (size_t q = 0; q < query_cnt; q++) {
+        for (size_t i = 0; i < data_cnt; i++)
+            column[i] = {dist[i * query_cnt + q], i};
+        std::partial_sort(column.begin(), column.begin() + k, column.end());
+        for (size_t i = 0; i < k; i++) {
+            idx.push_back(column[i].second);
+            out_dist.push_back(column[i].first);
+        }
+    }
+}
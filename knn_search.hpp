@@ -0,0 +1,149 @@
+#pragma once
+
+#include "gl.hpp"
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct vectors {
+    std::vector<double> vec;
+    size_t dim;
+    size_t cnt;
+
+    vectors(std::vector<double> vec, size_t dim, size_t cnt)
+        : vec(std::move(vec)), dim(dim), cnt(cnt) {}
+};
+
+vectors parse_vectors(const std::string &filename);
+void split_double(std::vector<double> &vec);
+void join_double(std::vector<double> &vec);
+
+GLint get_uniform_location(GLint program, const std::string &name);
+
+// Owning handle for a GL object, deleted when the handle goes away
+template <void (*Delete)(GLuint)>
+class gl_handle {
+public:
+    gl_handle() = default;
+    explicit gl_handle(GLuint id) : id(id) {}
+    gl_handle(gl_handle &&other) noexcept : id(std::exchange(other.id, 0)) {}
+    gl_handle &operator=(gl_handle &&other) noexcept {
+        std::swap(id, other.id);
+        return *this;
+    }
+    ~gl_handle() {
+        if (id)
+            Delete(id);
+    }
+
+    GLuint get() const { return id; }
+
+private:
+    GLuint id = 0;
+};
+
+inline void delete_texture(GLuint tex) { glDeleteTextures(1, &tex); }
+inline void delete_program(GLuint program) { glDeleteProgram(program); }
+
+using gl_texture = gl_handle<delete_texture>;
+using gl_program = gl_handle<delete_program>;
+
+gl_texture make_texture(GLuint width, GLuint height,
+                        GLenum format = GL_RG32F);
+// Uploads vectors as a dim x cnt texture of split doubles
+gl_texture vectors_to_texture(const vectors &vecs);
+// Multiplies every row of a split double texture (dim x cnt) by a projection
+// texture (dim x out_dim) on the GPU with the program built from
+// project.glsl, giving a new out_dim x cnt texture
+gl_texture project_texture(const gl_program &program,
+                           const gl_texture &src_tex, size_t cnt,
+                           const gl_texture &proj_tex, size_t out_dim);
+
+enum class precision_mode {
+    // Each double is stored as a (lo, hi) float pair and summed in double
+    emulated_double,
+    // Pairs are collapsed to a float and summed in float
+    single,
+};
+
+const char *precision_mode_name(precision_mode mode);
+
+// Brute-force GPU search of a fixed query set against a fixed data set.
+// Queries are dispatched in batches of at most `batch` vectors.
+class knn_searcher {
+public:
+    knn_searcher(const vectors &data, const vectors &queries, size_t batch,
+                 precision_mode mode);
+    // Adopts already uploaded data and query textures
+    knn_searcher(gl_texture data_tex, gl_texture query_tex, size_t dim,
+                 size_t data_cnt, size_t query_cnt, size_t batch,
+                 precision_mode mode);
+
+    // Distances of queries [offset, offset + cnt) to every data vector,
+    // laid out as dist[data_idx * cnt + query_idx - offset].
+    std::vector<double> distances(size_t offset, size_t cnt);
+
+    // The k nearest data vectors of queries [offset, offset + cnt), sorted by
+    // ascending distance and appended query by query to idx and dist.
+    void search(size_t offset, size_t cnt, size_t k, std::vector<size_t> &idx,
+                std::vector<double> &dist);
+
+    size_t batch() const { return batch_; }
+    size_t gpu_bytes() const;
+
+private:
+    size_t dim;
+    size_t data_cnt;
+    size_t query_cnt;
+    size_t batch_;
+    precision_mode mode;
+
+    gl_program program;
+    gl_texture data_tex;
+    gl_texture query_tex;
+    gl_texture dist_tex;
+    GLint query_offset_loc;
+    GLint single_precision_loc;
+};
+
+// Searches in a reduced space first: data and queries are projected on the
+// GPU, the rerank_k nearest candidates are found among the projections and
+// then re-ranked by their exact distance to the full vectors.
+class two_stage_searcher {
+public:
+    // projection holds out_dim rows of data.dim columns
+    two_stage_searcher(const vectors &data, const vectors &queries,
+                       const vectors &projection, size_t rerank_k,
+                       size_t batch, precision_mode mode);
+
+    // Same contract as knn_searcher::search, k must not exceed rerank_k
+    void search(size_t offset, size_t cnt, size_t k, std::vector<size_t> &idx,
+                std::vector<double> &dist);
+
+    size_t batch() const { return prefilter->batch(); }
+    size_t gpu_bytes() const;
+
+private:
+    size_t dim;
+    size_t data_cnt;
+    size_t query_cnt;
+    size_t reduced_dim;
+    size_t rerank_k;
+
+    gl_texture data_tex;
+    gl_texture query_tex;
+    std::unique_ptr<knn_searcher> prefilter;
+
+    gl_program rerank_program;
+    gl_texture cand_tex;
+    gl_texture rerank_dist_tex;
+    GLint query_offset_loc;
+};
+
+// Appends the k smallest entries of each query column of a distance matrix
+// laid out as returned by knn_searcher::distances.
+void select_topk(const std::vector<double> &dist, size_t query_cnt,
+                 size_t data_cnt, size_t k, std::vector<size_t> &idx,
+                 std::vector<double> &out_dist);
@@ -0,0 +1,381 @@
+#include "gl.hpp"
+#include "knn_search.hpp"
+#include "projection.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <stdexcept>
+#include <thread>
+
+struct eval_options {
+    std::string data_file = "../data.npy";
+    std::string query_file = "../queries.npy";
+    size_t k = 10;
+    size_t repeat = 5;
+    std::vector<precision_mode> modes{precision_mode::emulated_double,
+                                      precision_mode::single};
+    std::vector<size_t> batches{1, 16, 256};
+    // A reduced dimension of 0 searches the full vectors in a single stage
+    std::vector<size_t> reduced_dims{0};
+    std::vector<size_t> rerank_ks{100};
+    projection_kind projection = projection_kind::pca;
+    std::string csv_file;
+    std::string json_file;
+};
+
+struct eval_config {
+    precision_mode mode;
+    size_t batch;
+    size_t reduced_dim;
+    size_t rerank_k;
+};
+
+struct eval_result {
+    eval_config config;
+    double recall;
+    double max_dist_err;
+    double qps;
+    double p50_ms;
+    double p99_ms;
+    size_t gpu_bytes;
+    long rss_kb;
+};
+
+static std::vector<std::string> split_list(const std::string &list) {
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= list.size()) {
+        auto end = list.find(',', start);
+        if (end == std::string::npos)
+            end = list.size();
+        items.push_back(list.substr(start, end - start));
+        start = end + 1;
+    }
+    return items;
+}
+
+static precision_mode parse_precision_mode(const std::string &name) {
+    if (name == precision_mode_name(precision_mode::emulated_double))
+        return precision_mode::emulated_double;
+    if (name == precision_mode_name(precision_mode::single))
+        return precision_mode::single;
+    throw std::runtime_error("Unknown precision mode: " + name);
+}
+
+static eval_options parse_options(int argc, char **argv) {
+    eval_options opts;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+            throw std::runtime_error("Missing value for " + arg);
+        std::string val = argv[++i];
+        if (arg == "--data") {
+            opts.data_file = val;
+        } else if (arg == "--queries") {
+            opts.query_file = val;
+        } else if (arg == "--k") {
+            opts.k = std::stoul(val);
+        } else if (arg == "--repeat") {
+            opts.repeat = std::stoul(val);
+        } else if (arg == "--precision") {
+            opts.modes.clear();
+            for (auto &name : split_list(val))
+                opts.modes.push_back(parse_precision_mode(name));
+        } else if (arg == "--batch") {
+            opts.batches.clear();
+            for (auto &batch : split_list(val))
+                opts.batches.push_back(std::stoul(batch));
+        } else if (arg == "--reduce-dim") {
+            opts.reduced_dims.clear();
+            for (auto &reduced_dim : split_list(val))
+                opts.reduced_dims.push_back(std::stoul(reduced_dim));
+        } else if (arg == "--rerank") {
+            opts.rerank_ks.clear();
+            for (auto &rerank_k : split_list(val))
+                opts.rerank_ks.push_back(std::stoul(rerank_k));
+        } else if (arg == "--projection") {
+            opts.projection = parse_projection_kind(val);
+        } else if (arg == "--csv") {
+            opts.csv_file = val;
+        } else if (arg == "--json") {
+            opts.json_file = val;
+        } else {
+            throw std::runtime_error("Unknown option: " + arg);
+        }
+    }
+    if (opts.k == 0 || opts.repeat == 0)
+        throw std::runtime_error("k and repeat must be positive");
+    return opts;
+}
+
+static double exact_distance(const vectors &data, size_t data_idx,
+                             const vectors &queries, size_t query_idx) {
+    const double *d = &data.vec[data_idx * data.dim];
+    const double *q = &queries.vec[query_idx * queries.dim];
+    double sum = 0;
+    for (size_t i = 0; i < data.dim; i++) {
+        double diff = q[i] - d[i];
+        sum += diff * diff;
+    }
+    return std::sqrt(sum);
+}
+
+// Distance of the exact k-th nearest neighbour of every query, computed on
+// the CPU in double precision and split across all hardware threads.
+static std::vector<double> ground_truth(const vectors &data,
+                                        const vectors &queries, size_t k) {
+    std::vector<double> kth_dist(queries.cnt);
+    auto worker = [&](size_t first, size_t last) {
+        std::vector<std::pair<double, size_t>> column(data.cnt);
+        for (size_t q = first; q < last; q++) {
+            for (size_t i = 0; i < data.cnt; i++)
+                column[i] = {exact_distance(data, i, queries, q), i};
+            std::nth_element(column.begin(), column.begin() + k - 1,
+                             column.end());
+            kth_dist[q] = column[k - 1].first;
+        }
+    };
+
+    size_t thread_cnt = std::min<size_t>(std::thread::hardware_concurrency(),
+                                         queries.cnt);
+    thread_cnt = std::max<size_t>(thread_cnt, 1);
+    size_t per_thread = (queries.cnt + thread_cnt - 1) / thread_cnt;
+    std::vector<std::thread> threads;
+    for (size_t first = 0; first < queries.cnt; first += per_thread)
+        threads.emplace_back(worker, first,
+                             std::min(first + per_thread, queries.cnt));
+    for (auto &thread : threads)
+        thread.join();
+    return kth_dist;
+}
+
+static double percentile(std::vector<double> vals, double p) {
+    std::sort(vals.begin(), vals.end());
+    size_t rank = std::ceil(p / 100.0 * vals.size());
+    return vals[std::max<size_t>(rank, 1) - 1];
+}
+
+// Value of a "<key>: <n> kB" line of /proc/self/status, 0 if missing
+static long proc_status_kb(const std::string &key) {
+    FILE *status = fopen("/proc/self/status", "r");
+    if (!status)
+        return 0;
+    long kb = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), status)) {
+        if (key.compare(0, key.size(), line, key.size()) == 0 &&
+            line[key.size()] == ':') {
+            kb = std::stol(line + key.size() + 1);
+            break;
+        }
+    }
+    fclose(status);
+    return kb;
+}
+
+// Resets VmHWM to the current RSS, so it tracks the peak from here on
+static bool reset_peak_rss() {
+    FILE *clear_refs = fopen("/proc/self/clear_refs", "w");
+    if (!clear_refs)
+        return false;
+    bool ok = fputs("5", clear_refs) >= 0;
+    return fclose(clear_refs) == 0 && ok;
+}
+
+template <typename MakeSearcher>
+static eval_result run_config(MakeSearcher make_searcher,
+                              const eval_config &config, const vectors &data,
+                              const vectors &queries, size_t k,
+                              const std::vector<double> &kth_dist,
+                              size_t repeat) {
+    using clock = std::chrono::steady_clock;
+
+    // Host memory is measured from before the searcher exists, so each config
+    // only reports what it adds itself
+    bool peak_tracked = reset_peak_rss();
+    long rss_before = proc_status_kb("VmRSS");
+
+    auto searcher = make_searcher();
+    size_t batch = searcher.batch();
+
+    std::vector<size_t> idx;
+    std::vector<double> dist;
+    // Warm up: shader compilation and first-use allocations are not timed
+    searcher.search(0, batch, k, idx, dist);
+
+    std::vector<double> latencies_ms;
+    double total_s = 0;
+    for (size_t r = 0; r < repeat; r++) {
+        idx.clear();
+        dist.clear();
+        for (size_t offset = 0; offset < queries.cnt; offset += batch) {
+            size_t cnt = std::min(batch, queries.cnt - offset);
+            auto start = clock::now();
+            searcher.search(offset, cnt, k, idx, dist);
+            std::chrono::duration<double> elapsed = clock::now() - start;
+            latencies_ms.push_back(elapsed.count() * 1000);
+            total_s += elapsed.count();
+        }
+    }
+
+    size_t found = 0;
+    double max_dist_err = 0;
+    std::vector<size_t> hits;
+    for (size_t q = 0; q < queries.cnt; q++) {
+        // Any neighbour tied with the exact k-th one is an equally valid hit,
+        // but a neighbour returned more than once only counts once
+        double max_hit_dist = kth_dist[q] * (1 + 1e-9) + 1e-12;
+        hits.clear();
+        for (size_t i = q * k; i < (q + 1) * k; i++) {
+            double exact = exact_distance(data, idx[i], queries, q);
+            if (exact <= max_hit_dist)
+                hits.push_back(idx[i]);
+            max_dist_err = std::max(max_dist_err, std::abs(dist[i] - exact));
+        }
+        std::sort(hits.begin(), hits.end());
+        found += std::unique(hits.begin(), hits.end()) - hits.begin();
+    }
+
+    eval_result res;
+    res.config = config;
+    res.config.batch = batch;
+    res.recall = static_cast<double>(found) / (queries.cnt * k);
+    res.max_dist_err = max_dist_err;
+    res.qps = queries.cnt * repeat / total_s;
+    res.p50_ms = percentile(latencies_ms, 50);
+    res.p99_ms = percentile(latencies_ms, 99);
+    res.gpu_bytes = searcher.gpu_bytes();
+    long rss_after = proc_status_kb(peak_tracked ? "VmHWM" : "VmRSS");
+    res.rss_kb = std::max(rss_after - rss_before, 0L);
+    return res;
+}
+
+// Single-stage rows use no projection at all
+static const char *row_projection_name(const eval_config &config,
+                                       projection_kind projection) {
+    return config.reduced_dim ? projection_kind_name(projection) : "none";
+}
+
+static void write_csv(const std::string &filename, projection_kind projection,
+                      const std::vector<eval_result> &results) {
+    FILE *out = fopen(filename.c_str(), "w");
+    if (!out)
+        throw std::runtime_error("Failed to open " + filename);
+    fprintf(out, "precision,batch,projection,reduced_dim,rerank_k,recall,"
+                 "max_dist_err,qps,p50_ms,p99_ms,gpu_bytes,rss_kb\n");
+    for (auto &res : results) {
+        fprintf(out, "%s,%zu,%s,%zu,%zu,%.6f,%.6g,%.3f,%.6f,%.6f,%zu,%ld\n",
+                precision_mode_name(res.config.mode), res.config.batch,
+                row_projection_name(res.config, projection),
+                res.config.reduced_dim, res.config.rerank_k, res.recall,
+                res.max_dist_err, res.qps, res.p50_ms, res.p99_ms,
+                res.gpu_bytes, res.rss_kb);
+    }
+    fclose(out);
+}
+
+static void write_json(const std::string &filename, size_t k,
+                       projection_kind projection,
+                       const std::vector<eval_result> &results) {
+    FILE *out = fopen(filename.c_str(), "w");
+    if (!out)
+        throw std::runtime_error("Failed to open " + filename);
+    fprintf(out, "{\n  \"k\": %zu,\n  \"results\": [\n", k);
+    for (size_t i = 0; i < results.size(); i++) {
+        auto &res = results[i];
+        fprintf(out,
+                "    {\"precision\": \"%s\", \"batch\": %zu, "
+                "\"projection\": \"%s\", \"reduced_dim\": %zu, "
+                "\"rerank_k\": %zu, \"recall\": %.6f, "
+                "\"max_dist_err\": %.6g, \"qps\": %.3f, \"p50_ms\": %.6f, "
+                "\"p99_ms\": %.6f, \"gpu_bytes\": %zu, "
+                "\"rss_kb\": %ld}%s\n",
+                precision_mode_name(res.config.mode), res.config.batch,
+                row_projection_name(res.config, projection),
+                res.config.reduced_dim, res.config.rerank_k, res.recall,
+                res.max_dist_err, res.qps, res.p50_ms, res.p99_ms,
+                res.gpu_bytes, res.rss_kb,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    fclose(out);
+}
+
+int main(int argc, char **argv) {
+    auto opts = parse_options(argc, argv);
+    if (gl_init())
+        return 1;
+
+    auto data = parse_vectors(opts.data_file);
+    auto queries = parse_vectors(opts.query_file);
+    if (data.dim != queries.dim)
+        throw std::runtime_error("Data and query vecs don't match dimensions");
+    if (data.cnt == 0 || queries.cnt == 0)
+        throw std::runtime_error("Data and query sets must not be empty");
+    size_t k = std::min(opts.k, data.cnt);
+
+    auto kth_dist = ground_truth(data, queries, k);
+
+    std::map<size_t, vectors> projections;
+    for (auto reduced_dim : opts.reduced_dims) {
+        if (reduced_dim == 0 || projections.count(reduced_dim))
+            continue;
+        auto start = std::chrono::steady_clock::now();
+        projections.emplace(reduced_dim, train_projection(opts.projection,
+                                                          data, reduced_dim));
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        printf("trained %s projection to %zu dims in %.3f s\n",
+               projection_kind_name(opts.projection), reduced_dim,
+               elapsed.count());
+    }
+
+    std::vector<eval_result> results;
+    printf("%-10s %6s %7s %8s %8s %12s %12s %10s %10s %12s\n", "precision",
+           "batch", "reduced", "rerank", "recall", "max_err", "qps", "p50_ms",
+           "p99_ms", "gpu_bytes");
+    auto record = [&](const eval_result &res) {
+        printf("%-10s %6zu %7zu %8zu %8.4f %12.4g %12.1f %10.3f %10.3f "
+               "%12zu\n",
+               precision_mode_name(res.config.mode), res.config.batch,
+               res.config.reduced_dim, res.config.rerank_k, res.recall,
+               res.max_dist_err, res.qps, res.p50_ms, res.p99_ms,
+               res.gpu_bytes);
+        results.push_back(res);
+    };
+    for (auto mode : opts.modes) {
+        for (auto batch : opts.batches) {
+            for (auto reduced_dim : opts.reduced_dims) {
+                if (reduced_dim == 0) {
+                    eval_config config{mode, batch, 0, 0};
+                    auto make_searcher = [&] {
+                        return knn_searcher(data, queries, batch, mode);
+                    };
+                    record(run_config(make_searcher, config, data, queries, k,
+                                      kth_dist, opts.repeat));
+                    continue;
+                }
+                for (auto rerank_k : opts.rerank_ks) {
+                    rerank_k = std::min(std::max(rerank_k, k), data.cnt);
+                    eval_config config{mode, batch, reduced_dim, rerank_k};
+                    auto make_searcher = [&] {
+                        return two_stage_searcher(data, queries,
+                                                  projections.at(reduced_dim),
+                                                  rerank_k, batch, mode);
+                    };
+                    record(run_config(make_searcher, config, data, queries, k,
+                                      kth_dist, opts.repeat));
+                }
+            }
+        }
+    }
+
+    if (!opts.csv_file.empty())
+        write_csv(opts.csv_file, opts.projection, results);
+    if (!opts.json_file.empty())
+        write_json(opts.json_file, k, opts.projection, results);
+
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include "projection.hpp"
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+// Subspace iterations used to converge on the principal components
+constexpr int pca_iterations = 30;
+
+const char *projection_kind_name(projection_kind kind) {
+    switch (kind) {
+    case projection_kind::pca:
+        return "pca";
+    case projection_kind::random:
+        return "random";
+    }
+    return "unknown";
+}
+
+projection_kind parse_projection_kind(const std::string &name) {
+    if (name == projection_kind_name(projection_kind::pca))
+        return projection_kind::pca;
+    if (name == projection_kind_name(projection_kind::random))
+        return projection_kind::random;
+    throw std::runtime_error("Unknown projection: " + name);
+}
+
+static void check_out_dim(size_t dim, size_t out_dim) {
+    if (out_dim == 0 || out_dim > dim)
+        throw std::runtime_error("Reduced dimension must be in [1, " +
+                                 std::to_string(dim) + "]");
+}
+
+vectors random_projection(size_t dim, size_t out_dim, unsigned seed) {
+    check_out_dim(dim, out_dim);
+    std::mt19937_64 rng(seed);
+    std::normal_distribution<double> normal(0.0, 1.0 / std::sqrt(out_dim));
+    std::vector<double> proj(out_dim * dim);
+    for (double &p : proj)
+        p = normal(rng);
+    return vectors(std::move(proj), dim, out_dim);
+}
+
+// Modified Gram-Schmidt over the rows. Rows that become degenerate (the data
+// has fewer independent directions than rows) are zeroed.
+static void orthonormalize(std::vector<double> &rows, size_t dim,
+                           size_t cnt) {
+    for (size_t r = 0; r < cnt; r++) {
+        double *row = &rows[r * dim];
+        for (size_t p = 0; p < r; p++) {
+            const double *prev = &rows[p * dim];
+            double dot = 0;
+            for (size_t i = 0; i < dim; i++)
+                dot += row[i] * prev[i];
+            for (size_t i = 0; i < dim; i++)
+                row[i] -= dot * prev[i];
+        }
+        double norm = 0;
+        for (size_t i = 0; i < dim; i++)
+            norm += row[i] * row[i];
+        norm = std::sqrt(norm);
+        double scale = norm > 1e-12 ? 1.0 / norm : 0.0;
+        for (size_t i = 0; i < dim; i++)
+            row[i] *= scale;
+    }
+}
+
+vectors train_pca(const vectors &data, size_t out_dim, size_t max_samples) {
+    size_t dim = data.dim;
+    check_out_dim(dim, out_dim);
+    if (data.cnt == 0 || max_samples == 0)
+        throw std::runtime_error("No samples to train PCA on");
+    size_t stride = (data.cnt + max_samples - 1) / max_samples;
+
+    std::vector<double> mean(dim, 0.0);
+    size_t samples = 0;
+    for (size_t v = 0; v < data.cnt; v += stride, samples++) {
+        const double *x = &data.vec[v * dim];
+        for (size_t i = 0; i < dim; i++)
+            mean[i] += x[i];
+    }
+    for (double &m : mean)
+        m /= samples;
+
+    std::vector<double> cov(dim * dim, 0.0);
+    std::vector<double> centered(dim);
+    for (size_t v = 0; v < data.cnt; v += stride) {
+        const double *x = &data.vec[v * dim];
+        for (size_t i = 0; i < dim; i++)
+            centered[i] = x[i] - mean[i];
+        for (size_t i = 0; i < dim; i++) {
+            double ci = centered[i];
+            double *cov_row = &cov[i * dim];
+            for (size_t j = i; j < dim; j++)
+                cov_row[j] += ci * centered[j];
+        }
+    }
+    for (size_t i = 0; i < dim; i++) {
+        for (size_t j = i; j < dim; j++) {
+            cov[i * dim + j] /= samples;
+            cov[j * dim + i] = cov[i * dim + j];
+        }
+    }
+
+    // Only the spanned subspace matters for distances, so the basis is not
+    // rotated onto the individual eigenvectors.
+    auto basis = random_projection(dim, out_dim).vec;
+    orthonormalize(basis, dim, out_dim);
+    std::vector<double> next(out_dim * dim);
+    for (int it = 0; it < pca_iterations; it++) {
+        for (size_t r = 0; r < out_dim; r++) {
+            const double *b = &basis[r * dim];
+            for (size_t i = 0; i < dim; i++) {
+                const double *cov_row = &cov[i * dim];
+                double sum = 0;
+                for (size_t j = 0; j < dim; j++)
+                    sum += cov_row[j] * b[j];
+                next[r * dim + i] = sum;
+            }
+        }
+        orthonormalize(next, dim, out_dim);
+        std::swap(basis, next);
+    }
+
+    return vectors(std::move(basis), dim, out_dim);
+}
+
+vectors train_projection(projection_kind kind, const vectors &data,
+                         size_t out_dim) {
+    switch (kind) {
+    case projection_kind::pca:
+        return train_pca(data, out_dim);
+    case projection_kind::random:
+        return random_projection(data.dim, out_dim);
+    }
+    throw std::runtime_error("Unknown projection");
+}
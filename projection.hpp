@@ -0,0 +1,22 @@
+#pragma once
+
+#include "knn_search.hpp"
+
+enum class projection_kind {
+    // Top principal components of the data set
+    pca,
+    // Gaussian random projection, independent of the data
+    random,
+};
+
+const char *projection_kind_name(projection_kind kind);
+projection_kind parse_projection_kind(const std::string &name);
+
+// All projections are returned as out_dim row vectors of dim columns, ready
+// for two_stage_searcher.
+vectors random_projection(size_t dim, size_t out_dim, unsigned seed = 0);
+// The covariance is estimated from at most max_samples evenly strided vectors
+vectors train_pca(const vectors &data, size_t out_dim,
+                  size_t max_samples = 10000);
+vectors train_projection(projection_kind kind, const vectors &data,
+                         size_t out_dim);